@@ -0,0 +1,72 @@
+// audit_bench: per-command cost of the shell's audit hook.
+//
+//   audit_bench [COMMANDS] [SEGMENT_SIZE]
+//
+// Times exactly what main() adds around a command: three clock reads,
+// auditCurrentDir and AuditLog::record, including segment rotation.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "audit.hpp"
+using namespace std;
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t segmentSize = argc > 2 ? strtoull(argv[2], nullptr, 10) : AUDIT_DEFAULT_SEGMENT_SIZE;
+    if (iterations == 0) {
+        fprintf(stderr, "usage: audit_bench [COMMANDS] [SEGMENT_SIZE]\n");
+        return 2;
+    }
+
+    filesystem::path dir = filesystem::temp_directory_path() / ("audit_bench-" + to_string(getpid()));
+    AuditLog audit;
+    if (!audit.open(dir, segmentSize)) {
+        return 1;
+    }
+
+    // A realistic mix: a small working set of repeated commands plus some unique ones
+    vector<string> commands;
+    for (int i = 0; i < 64; i++) {
+        commands.push_back("ls -la /var/log/service-" + to_string(i) + " > listing.txt");
+    }
+
+    vector<int64_t> samples(iterations);
+    for (size_t i = 0; i < iterations; i++) {
+        string unique;
+        const string* command = &commands[i % commands.size()];
+        if (i % 16 == 0) {
+            unique = "grep -n pattern-" + to_string(i) + " build.log";
+            command = &unique;
+        }
+
+        // Same capture as main()
+        int64_t begin = auditMonotonicNs();
+        int64_t start = auditRealtimeNs();
+        int64_t startMono = auditMonotonicNs();
+        string cwd = auditCurrentDir();
+        audit.record(*command, cwd, start, auditMonotonicNs() - startMono, 0);
+        samples[i] = auditMonotonicNs() - begin;
+    }
+    audit.close();
+
+    // Every statistic covers the same hook-only interval
+    double mean = accumulate(samples.begin(), samples.end(), 0.0) / iterations;
+
+    sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) { return samples[min(samples.size() - 1, size_t(p * samples.size()))]; };
+    printf("commands:  %zu\n", iterations);
+    printf("mean:      %.0f ns\n", mean);
+    printf("p50:       %lld ns\n", (long long)percentile(0.50));
+    printf("p99:       %lld ns\n", (long long)percentile(0.99));
+    printf("p99.9:     %lld ns\n", (long long)percentile(0.999));
+    printf("max:       %lld ns\n", (long long)samples.back());
+
+    filesystem::remove_all(dir);
+    return 0;
+}
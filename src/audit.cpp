@@ -0,0 +1,436 @@
+#include "audit.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static size_t stringEntrySize(size_t length) {
+    return sizeof(AuditStringEntry) + alignUp(length, 8);
+}
+
+// Allocates `size` bytes of real blocks for `fd`, returning 0 or an errno value.
+static int reserveSpace(int fd, size_t size) {
+    int err = posix_fallocate(fd, 0, size);
+    if (err != EOPNOTSUPP && err != EINVAL) return err;
+
+    // No fallocate support here; writing zeros allocates the blocks just the same
+    static const char zeros[4096] = {};
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t written = pwrite(fd, zeros, min(sizeof(zeros), size - offset), offset);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (written == 0) return ENOSPC;
+        offset += written;
+    }
+    return 0;
+}
+
+int64_t auditRealtimeNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int64_t auditMonotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+string auditCurrentDir() {
+    char buffer[PATH_MAX];
+    if (getcwd(buffer, sizeof(buffer))) return buffer;
+    if (errno != ERANGE) return "";
+
+    // Deeper than PATH_MAX: let glibc size the buffer so the path is kept whole
+    char* cwd = getcwd(nullptr, 0);
+    if (!cwd) return "";
+    string result = cwd;
+    free(cwd);
+    return result;
+}
+
+AuditLog::Segment::~Segment() {
+    if (base) {
+        size_t end = used();
+        munmap(base, capacity);
+        // Give back the preallocated space past the last record
+        if (ftruncate(fd, end) == -1) {
+            perror("audit: ftruncate");
+        }
+    }
+    if (fd != -1) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+size_t AuditLog::Segment::used() const {
+    return atomic_ref<uint64_t>(header()->used).load(memory_order_acquire);
+}
+
+void AuditLog::Segment::sync() {
+    size_t end = used();
+    if (end <= synced) return;
+    // Only dirty pages are written back, so syncing from the start is cheap
+    if (msync(base, end, MS_SYNC) == -1) {
+        perror("audit: msync");
+        return;
+    }
+    synced = end;
+}
+
+AuditLog::~AuditLog() {
+    close();
+}
+
+bool AuditLog::open(const string& directory, size_t size) {
+    close();
+
+    error_code ec;
+    filesystem::create_directories(directory, ec);
+    if (ec) {
+        cerr << "audit: " << directory << ": " << ec.message() << endl;
+        return false;
+    }
+
+    dir = directory;
+    segmentSize = alignUp(clamp(size, AUDIT_MIN_SEGMENT_SIZE, AUDIT_MAX_SEGMENT_SIZE), sysconf(_SC_PAGESIZE));
+    sessionStartNs = auditRealtimeNs();
+    sessionName = "audit-" + to_string(sessionStartNs / 1000000000) + "-" + to_string(getpid());
+    segmentIndex = 0;
+
+    current = openSegment();
+    if (!current) return false;
+    tail = sizeof(AuditSegmentHeader);
+    active = current;
+    spareFailed = false;
+    stopping = false;
+    flusher = thread(&AuditLog::flushLoop, this);
+    return true;
+}
+
+shared_ptr<AuditLog::Segment> AuditLog::openSegment(bool reportErrors) {
+    // Failed attempts don't use up an index, so file names stay contiguous
+    uint32_t index = segmentIndex;
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%06u.log", index);
+    string path = dir + "/" + sessionName + suffix;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        if (reportErrors) perror(("audit: " + path).c_str());
+        return nullptr;
+    }
+
+    // Every block must exist before the file is mapped: a write into a hole
+    // on a full disk raises SIGBUS instead of returning an error
+    if (int err = reserveSpace(fd, segmentSize)) {
+        errno = err;
+        if (reportErrors) perror(("audit: " + path).c_str());
+        ::close(fd);
+        unlink(path.c_str());
+        return nullptr;
+    }
+
+    // Prefault the pages too; spares are mapped on the flush thread, off the hot path
+    void* base = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (base == MAP_FAILED) {
+        if (reportErrors) perror("audit: mmap");
+        ::close(fd);
+        unlink(path.c_str());
+        return nullptr;
+    }
+
+    auto segment = make_shared<Segment>();
+    segment->path = path;
+    segment->fd = fd;
+    segment->base = static_cast<char*>(base);
+    segment->capacity = segmentSize;
+
+    AuditSegmentHeader* header = segment->header();
+    memcpy(header->magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+    header->version = AUDIT_VERSION;
+    header->headerSize = sizeof(AuditSegmentHeader);
+    header->capacity = segmentSize;
+    header->sessionStartNs = sessionStartNs;
+    header->pid = getpid();
+    header->segmentIndex = index;
+    atomic_ref<uint64_t>(header->used).store(sizeof(AuditSegmentHeader), memory_order_release);
+    segmentIndex++;
+    return segment;
+}
+
+void AuditLog::rotate() {
+    shared_ptr<Segment> next;
+    {
+        unique_lock<mutex> guard(lock);
+        // The flush thread normally has the spare ready long before it's needed.
+        // If not, this blocks the prompt until it is (see audit.hpp); if its
+        // last attempt failed, don't wait for the retry.
+        spareReady.wait(guard, [this] { return spare || spareFailed; });
+        next = move(spare);
+        retired.push_back(move(current));
+        active = next;
+    }
+    wakeup.notify_one();
+
+    current = next;
+    tail = sizeof(AuditSegmentHeader);
+    strings.clear();
+}
+
+bool AuditLog::resume() {
+    {
+        lock_guard<mutex> guard(lock);
+        if (!spare) return false;
+        current = move(spare);
+        active = current;
+    }
+    wakeup.notify_one();
+    tail = sizeof(AuditSegmentHeader);
+    strings.clear();
+    return true;
+}
+
+uint32_t AuditLog::intern(const string& text) {
+    auto [it, inserted] = strings.try_emplace(text, uint32_t(strings.size()));
+    if (!inserted) return it->second;
+
+    auto* entry = reinterpret_cast<AuditStringEntry*>(current->base + tail);
+    size_t size = stringEntrySize(text.size());
+    entry->header = {AUDIT_STRING, uint32_t(size)};
+    entry->id = it->second;
+    entry->length = text.size();
+    char* bytes = reinterpret_cast<char*>(entry + 1);
+    memcpy(bytes, text.data(), text.size());
+    memset(bytes + text.size(), 0, size - sizeof(AuditStringEntry) - text.size());
+    tail += size;
+    return it->second;
+}
+
+void AuditLog::record(const string& command, const string& cwd,
+                      int64_t startNs, int64_t durationNs, int exitStatus) {
+    if (!isOpen()) return;
+    if (!current && !resume()) {
+        drop(startNs);
+        return;
+    }
+
+    // Clip text so that a record with two fresh strings always fits an empty segment
+    size_t maxText = (segmentSize - sizeof(AuditSegmentHeader) - sizeof(AuditGapEntry)
+                      - sizeof(AuditCommandEntry) - 2 * stringEntrySize(0) - 16) / 2;
+    const string* commandText = &command;
+    const string* cwdText = &cwd;
+    string clippedCommand, clippedCwd;
+    if (command.size() > maxText) {
+        clippedCommand = command.substr(0, maxText);
+        commandText = &clippedCommand;
+    }
+    if (cwd.size() > maxText) {
+        clippedCwd = cwd.substr(0, maxText);
+        cwdText = &clippedCwd;
+    }
+
+    size_t needed = sizeof(AuditCommandEntry);
+    if (!strings.contains(*commandText)) needed += stringEntrySize(commandText->size());
+    if (!strings.contains(*cwdText)) needed += stringEntrySize(cwdText->size());
+    if (dropped) needed += sizeof(AuditGapEntry);
+    if (tail + needed > current->capacity) {
+        rotate();
+        if (!current) {
+            drop(startNs);
+            return;
+        }
+    }
+
+    if (dropped) {
+        auto* gap = reinterpret_cast<AuditGapEntry*>(current->base + tail);
+        *gap = {{AUDIT_GAP, sizeof(AuditGapEntry)}, dropped, gapFirstNs, gapLastNs};
+        tail += sizeof(AuditGapEntry);
+        cerr << "audit: resumed after dropping " << dropped << " records" << endl;
+        dropped = 0;
+    }
+
+    uint32_t commandId = intern(*commandText);
+    uint32_t cwdId = intern(*cwdText);
+
+    auto* entry = reinterpret_cast<AuditCommandEntry*>(current->base + tail);
+    entry->header = {AUDIT_COMMAND, sizeof(AuditCommandEntry)};
+    entry->commandId = commandId;
+    entry->cwdId = cwdId;
+    entry->startNs = startNs;
+    entry->durationNs = durationNs;
+    entry->exitStatus = exitStatus;
+    entry->reserved = 0;
+    tail += sizeof(AuditCommandEntry);
+
+    // Publish the strings and the record together
+    atomic_ref<uint64_t>(current->header()->used).store(tail, memory_order_release);
+}
+
+void AuditLog::drop(int64_t startNs) {
+    if (dropped == 0) {
+        gapFirstNs = startNs;
+        cerr << "audit: no log segment available, dropping records until one can be created" << endl;
+    }
+    gapLastNs = startNs;
+    dropped++;
+    droppedTotal++;
+}
+
+void AuditLog::flushLoop() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        wakeup.wait_for(guard, AUDIT_FLUSH_INTERVAL, [this] {
+            return stopping || !retired.empty() || (!spare && !spareFailed);
+        });
+        vector<shared_ptr<Segment>> done = move(retired);
+        retired.clear();
+        shared_ptr<Segment> segment = active;
+        bool stop = stopping;
+        // Retry after a failure too, at most once per interval
+        bool needSpare = !spare && !stop;
+        bool reportErrors = !spareFailed;
+        guard.unlock();
+
+        // Only the first failure of a run is reported; retries stay quiet
+        shared_ptr<Segment> prepared;
+        if (needSpare) prepared = openSegment(reportErrors);
+
+        // Dropping a retired segment syncs, trims and closes it
+        done.clear();
+        if (segment) segment->sync();
+        segment.reset();
+
+        guard.lock();
+        if (needSpare) {
+            spare = move(prepared);
+            spareFailed = !spare;
+            spareReady.notify_one();
+        }
+        if (stop) return;
+    }
+}
+
+void AuditLog::close() {
+    if (flusher.joinable()) {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        flusher.join();
+    }
+    // An unused spare holds no records
+    if (spare) unlink(spare->path.c_str());
+    spare.reset();
+    retired.clear();
+    active.reset();
+    current.reset();
+    strings.clear();
+    tail = 0;
+
+    if (droppedTotal) {
+        cerr << "audit: " << droppedTotal << " records were dropped this session" << endl;
+    }
+    dropped = 0;
+    droppedTotal = 0;
+}
+
+bool readAuditSegment(const string& path, vector<AuditRecord>& records, string& error) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        error = strerror(errno);
+        return false;
+    }
+    vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    AuditSegmentHeader header;
+    if (data.size() < sizeof(header)) {
+        error = "too short for an audit segment";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC)) != 0) {
+        error = "not an audit segment";
+        return false;
+    }
+    if (header.version != AUDIT_VERSION) {
+        error = "unsupported audit version " + to_string(header.version);
+        return false;
+    }
+    if (header.headerSize < sizeof(header) || header.headerSize % 8 != 0) {
+        error = "corrupt segment header";
+        return false;
+    }
+
+    size_t end = min<size_t>(header.used, data.size());
+    size_t offset = header.headerSize;
+    vector<string> strings;
+    auto corrupt = [&] {
+        error = "corrupt entry at offset " + to_string(offset);
+        return false;
+    };
+
+    while (offset + sizeof(AuditEntryHeader) <= end) {
+        AuditEntryHeader entry;
+        memcpy(&entry, data.data() + offset, sizeof(entry));
+        if (entry.size < sizeof(AuditEntryHeader) || entry.size % 8 != 0 || entry.size > end - offset) {
+            return corrupt();
+        }
+
+        if (entry.kind == AUDIT_STRING) {
+            AuditStringEntry text;
+            if (entry.size < sizeof(text)) return corrupt();
+            memcpy(&text, data.data() + offset, sizeof(text));
+            // The writer hands out ids in order, so anything else is damage
+            if (text.id != strings.size() || text.length > entry.size - sizeof(text)) {
+                return corrupt();
+            }
+            strings.emplace_back(data.data() + offset + sizeof(text), text.length);
+        } else if (entry.kind == AUDIT_COMMAND) {
+            AuditCommandEntry command;
+            if (entry.size < sizeof(command)) return corrupt();
+            memcpy(&command, data.data() + offset, sizeof(command));
+            if (command.commandId >= strings.size() || command.cwdId >= strings.size()) {
+                return corrupt();
+            }
+            records.push_back({strings[command.commandId], strings[command.cwdId],
+                               command.startNs, command.durationNs, command.exitStatus});
+        } else if (entry.kind == AUDIT_GAP) {
+            AuditGapEntry gap;
+            if (entry.size < sizeof(gap)) return corrupt();
+            memcpy(&gap, data.data() + offset, sizeof(gap));
+            AuditRecord record;
+            record.startNs = gap.firstStartNs;
+            record.dropped = gap.dropped;
+            record.gapEndNs = gap.lastStartNs;
+            records.push_back(record);
+        }
+        // Unknown kinds are skipped so newer writers stay readable
+
+        offset += entry.size;
+    }
+    return true;
+}
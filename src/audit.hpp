@@ -0,0 +1,185 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Session audit log.
+//
+// Every command the shell dispatches is appended as a fixed-layout binary
+// record to a memory-mapped log segment. Command and cwd text is interned in
+// a per-segment string table, so each segment decodes on its own. A
+// background thread msyncs new data, retires full segments and keeps a
+// preallocated spare ready, so appends normally touch no disk.
+//
+// The shell thread can still stall at rotation: if a segment fills before
+// the spare is ready, record() waits for the flush thread to finish. That
+// wait can include creating, preallocating and prefaulting a whole segment,
+// plus any msync already in progress. Records are never dropped for this.
+//
+// Segment layout:
+//   AuditSegmentHeader
+//   entry*            (AuditStringEntry + padded bytes | AuditCommandEntry | AuditGapEntry)
+// Every entry starts with an AuditEntryHeader and is 8-byte aligned.
+// `used` in the segment header is published after each record, so a reader
+// never sees a half-written entry.
+
+constexpr char AUDIT_MAGIC[8] = {'S', 'H', 'A', 'U', 'D', 'I', 'T', '1'};
+constexpr uint32_t AUDIT_VERSION = 1;
+constexpr size_t AUDIT_DEFAULT_SEGMENT_SIZE = 4 * 1024 * 1024;
+constexpr size_t AUDIT_MIN_SEGMENT_SIZE = 4096;
+constexpr size_t AUDIT_MAX_SEGMENT_SIZE = size_t(1) << 30;
+constexpr std::chrono::milliseconds AUDIT_FLUSH_INTERVAL{100};
+
+struct AuditSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t capacity;
+    uint64_t used;              // bytes of valid data, including this header
+    uint64_t sessionStartNs;    // CLOCK_REALTIME, nanoseconds since the epoch
+    uint32_t pid;
+    uint32_t segmentIndex;
+    uint64_t reserved[2];
+};
+static_assert(sizeof(AuditSegmentHeader) == 64);
+
+enum AuditEntryKind : uint32_t {
+    AUDIT_STRING = 1,
+    AUDIT_COMMAND = 2,
+    AUDIT_GAP = 3
+};
+
+struct AuditEntryHeader {
+    uint32_t kind;
+    uint32_t size;              // whole entry, including padding
+};
+
+struct AuditStringEntry {
+    AuditEntryHeader header;
+    uint32_t id;
+    uint32_t length;
+    // `length` bytes follow, zero-padded to a multiple of 8
+};
+static_assert(sizeof(AuditStringEntry) == 16);
+
+struct AuditCommandEntry {
+    AuditEntryHeader header;
+    uint32_t commandId;
+    uint32_t cwdId;
+    int64_t startNs;            // CLOCK_REALTIME, nanoseconds since the epoch
+    int64_t durationNs;
+    int32_t exitStatus;
+    uint32_t reserved;
+};
+static_assert(sizeof(AuditCommandEntry) == 40);
+
+// Written when a segment opens after records were dropped for lack of one.
+struct AuditGapEntry {
+    AuditEntryHeader header;
+    uint64_t dropped;
+    int64_t firstStartNs;       // start of the first and last dropped command
+    int64_t lastStartNs;
+};
+static_assert(sizeof(AuditGapEntry) == 32);
+
+int64_t auditRealtimeNs();
+int64_t auditMonotonicNs();
+// The working directory in full, or "" if it can't be determined.
+std::string auditCurrentDir();
+
+// A decoded command record, or a gap marker when `dropped` is nonzero.
+struct AuditRecord {
+    std::string command;
+    std::string cwd;
+    int64_t startNs = 0;
+    int64_t durationNs = 0;
+    int32_t exitStatus = 0;
+    uint64_t dropped = 0;
+    int64_t gapEndNs = 0;       // start of the last dropped command
+};
+
+// Appends the records of one segment file to `records`. A segment cut short
+// by a crash decodes up to its last whole entry. On malformed input the
+// records before it are kept, `error` says what was wrong and false is returned.
+bool readAuditSegment(const std::string& path, std::vector<AuditRecord>& records, std::string& error);
+
+class AuditLog {
+public:
+    AuditLog() = default;
+    ~AuditLog();
+
+    AuditLog(const AuditLog&) = delete;
+    AuditLog& operator=(const AuditLog&) = delete;
+
+    // Creates `dir` if needed and starts a new session there.
+    // Returns false (after reporting the error) if the log can't be opened.
+    bool open(const std::string& dir, size_t segmentSize = AUDIT_DEFAULT_SEGMENT_SIZE);
+    bool isOpen() const { return flusher.joinable(); }
+
+    // If no segment could be created, the record is counted as dropped and
+    // a gap marker is written once a segment becomes available again.
+    void record(const std::string& command, const std::string& cwd,
+                int64_t startNs, int64_t durationNs, int exitStatus);
+
+    // Records dropped so far this session.
+    uint64_t droppedCount() const { return droppedTotal; }
+
+    // Stops the flush thread, syncs everything to disk and reports any
+    // records dropped during the session.
+    void close();
+
+private:
+    struct Segment {
+        std::string path;
+        int fd = -1;
+        char* base = nullptr;
+        size_t capacity = 0;
+        size_t synced = 0;      // only touched by whoever owns flushing
+
+        ~Segment();
+        AuditSegmentHeader* header() const { return reinterpret_cast<AuditSegmentHeader*>(base); }
+        size_t used() const;
+        void sync();
+    };
+
+    std::shared_ptr<Segment> openSegment(bool reportErrors = true);
+    void rotate();
+    bool resume();
+    void drop(int64_t startNs);
+    uint32_t intern(const std::string& text);
+    void flushLoop();
+
+    std::string dir;
+    std::string sessionName;
+    size_t segmentSize = AUDIT_DEFAULT_SEGMENT_SIZE;
+    int64_t sessionStartNs = 0;
+    uint32_t segmentIndex = 0;
+
+    // Owned by the shell thread.
+    std::shared_ptr<Segment> current;
+    size_t tail = 0;
+    std::unordered_map<std::string, uint32_t> strings;
+    uint64_t dropped = 0;       // since the last gap marker
+    uint64_t droppedTotal = 0;
+    int64_t gapFirstNs = 0;
+    int64_t gapLastNs = 0;
+
+    // Shared with the flush thread, guarded by `lock`.
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable spareReady;
+    std::shared_ptr<Segment> active;
+    std::shared_ptr<Segment> spare;
+    std::vector<std::shared_ptr<Segment>> retired;
+    bool spareFailed = false;   // the last attempt failed; retried every flush interval
+    bool stopping = false;
+    std::thread flusher;
+};
@@ -10,6 +10,8 @@
 #include <termios.h>
 #include <set>
 #include <algorithm>
+#include <cerrno>
+#include "audit.hpp"
 using namespace std;
 
 enum ValidCommands {
@@ -332,6 +334,27 @@ int main() {
 
     termios orig_termios;
     enableRawMode(orig_termios);
+
+    // Record every dispatched command when SHELL_AUDIT_DIR is set
+    AuditLog audit;
+    if (char* auditDir = getenv("SHELL_AUDIT_DIR")) {
+        size_t segmentSize = AUDIT_DEFAULT_SEGMENT_SIZE;
+        if (char* size = getenv("SHELL_AUDIT_SEGMENT_SIZE")) {
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long parsed = strtoull(size, &end, 10);
+            // strtoull skips leading spaces and accepts a sign, so require a digit first
+            if (!isdigit(static_cast<unsigned char>(size[0])) || errno != 0 || *end != '\0'
+                || parsed == 0 || parsed > AUDIT_MAX_SEGMENT_SIZE) {
+                cerr << "audit: ignoring invalid SHELL_AUDIT_SEGMENT_SIZE '" << size
+                     << "' (must be 1.." << AUDIT_MAX_SEGMENT_SIZE << "), using "
+                     << AUDIT_DEFAULT_SEGMENT_SIZE << endl;
+            } else {
+                segmentSize = parsed;
+            }
+        }
+        audit.open(auditDir, segmentSize);
+    }
     
     // Variables to track tab completion state
     bool tabPressed = false;
@@ -531,6 +554,16 @@ int main() {
         // Use commandPart instead of input for command parsing
         ValidCommands command = isValid(commandPart);
 
+        // Capture audit context before the command can change it
+        int status = 0;
+        int64_t auditStart = 0, auditStartMono = 0;
+        string auditCwd;
+        if (audit.isOpen()) {
+            auditStart = auditRealtimeNs();
+            auditStartMono = auditMonotonicNs();
+            auditCwd = auditCurrentDir();
+        }
+
         // Set up stdout redirection if needed
         int originalStdout = -1;
         if (!stdoutFile.empty()) {
@@ -575,6 +608,7 @@ int main() {
                 }
                 else{
                     cout<<dir<<": No such file or directory"<<endl;
+                    status = 1;
                 }
                 break;
             }
@@ -601,6 +635,7 @@ int main() {
                     string path = getPath(commandPart);
                     if(path.empty()){
                         cout << commandPart << ": not found" << endl;
+                        status = 1;
                     }
                     else{
                         cout << commandPart << " is " << path << endl;
@@ -615,10 +650,14 @@ int main() {
                 }
                 else{
                     perror("getcwd");
+                    status = 1;
                 }
                 break;
             }
             case exit0:
+                if (audit.isOpen()) {
+                    audit.record(input, auditCwd, auditStart, auditMonotonicNs() - auditStartMono, 0);
+                }
                 disableRawMode(orig_termios);
                 return 0;
             default: {
@@ -627,6 +666,7 @@ int main() {
                 string path = getPath(args[0]);
                 if(path.empty()){
                     cout<<commandPart<<": command not found"<<endl;
+                    status = 127;
                     break;
                 }
 
@@ -642,9 +682,12 @@ int main() {
                     perror("execv");
                     exit(1);
                 } else if(pid > 0) {
-                    wait(nullptr);
+                    int waitStatus = 0;
+                    waitpid(pid, &waitStatus, 0);
+                    status = WIFEXITED(waitStatus) ? WEXITSTATUS(waitStatus) : 128 + WTERMSIG(waitStatus);
                 } else {
                     perror("fork");
+                    status = 1;
                 }
                 break;
             }
@@ -661,5 +704,9 @@ int main() {
             dup2(originalStderr, STDERR_FILENO);
             close(originalStderr);
         }
+
+        if (audit.isOpen()) {
+            audit.record(input, auditCwd, auditStart, auditMonotonicNs() - auditStartMono, status);
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,260 @@
+// audit_test: round trip between AuditLog and readAuditSegment.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "audit.hpp"
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                   \
+    do {                                                                   \
+        if (!(condition)) {                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+filesystem::path scratchDir(const string& name) {
+    filesystem::path dir = filesystem::temp_directory_path() / ("audit_test-" + to_string(getpid()) + "-" + name);
+    filesystem::remove_all(dir);
+    return dir;
+}
+
+// Decodes every segment in `dir` in file-name order
+vector<AuditRecord> readAll(const filesystem::path& dir, size_t* segments = nullptr) {
+    vector<string> paths;
+    for (const auto& entry : filesystem::directory_iterator(dir)) {
+        paths.push_back(entry.path().string());
+    }
+    sort(paths.begin(), paths.end());
+    if (segments) *segments = paths.size();
+
+    vector<AuditRecord> records;
+    for (const auto& path : paths) {
+        string error;
+        bool ok = readAuditSegment(path, records, error);
+        if (!ok) fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+        CHECK(ok);
+    }
+    return records;
+}
+
+string commandFor(int i) {
+    // Repeats exercise interning; tabs, newlines and backslashes must survive as-is
+    if (i % 7 == 0) return "echo repeated";
+    if (i % 11 == 0) return "printf 'a\tb\\n' \n" + to_string(i);
+    return "ls -la /var/log/service-" + to_string(i);
+}
+
+string cwdFor(int i) {
+    return "/home/user/project-" + to_string(i % 5);
+}
+
+void testRoundTripWithRotation() {
+    filesystem::path dir = scratchDir("roundtrip");
+    const int count = 500;
+    {
+        AuditLog audit;
+        CHECK(audit.open(dir, 4096));
+        for (int i = 0; i < count; i++) {
+            audit.record(commandFor(i), cwdFor(i), 1700000000000000000 + i * 1000, i * 7, i % 3 == 0 ? 0 : i);
+        }
+        audit.close();
+    }
+
+    size_t segments = 0;
+    vector<AuditRecord> records = readAll(dir, &segments);
+    CHECK(segments >= 5);
+    CHECK(records.size() == size_t(count));
+    for (int i = 0; i < count && i < int(records.size()); i++) {
+        const AuditRecord& record = records[i];
+        CHECK(record.command == commandFor(i));
+        CHECK(record.cwd == cwdFor(i));
+        CHECK(record.startNs == 1700000000000000000 + i * 1000);
+        CHECK(record.durationNs == i * 7);
+        CHECK(record.exitStatus == (i % 3 == 0 ? 0 : i));
+        CHECK(record.dropped == 0);
+    }
+    filesystem::remove_all(dir);
+}
+
+void testOversizedTextIsClipped() {
+    filesystem::path dir = scratchDir("clip");
+    string command(10000, 'x');
+    {
+        AuditLog audit;
+        CHECK(audit.open(dir, 4096));
+        audit.record(command, "/", 1, 2, 0);
+        audit.record("after", "/", 3, 4, 0);
+    }
+
+    vector<AuditRecord> records = readAll(dir);
+    CHECK(records.size() == 2);
+    if (records.size() == 2) {
+        CHECK(!records[0].command.empty());
+        CHECK(records[0].command.size() < command.size());
+        CHECK(command.starts_with(records[0].command));
+        CHECK(records[1].command == "after");
+    }
+    filesystem::remove_all(dir);
+}
+
+// Records through an outage caused by `breakLog` and recovered by `fixLog`,
+// then checks that written and dropped records account for every command.
+// Progress is observed through droppedCount(), never through sleeps.
+void checkGapAfterOutage(const string& name, const function<void(const filesystem::path&)>& breakLog,
+                         const function<void(const filesystem::path&)>& fixLog) {
+    filesystem::path dir = scratchDir(name);
+    int recorded = 0;
+    {
+        AuditLog audit;
+        CHECK(audit.open(dir, 4096));
+        breakLog(dir);
+        // Far more than one spare can hold, so some records must be dropped
+        for (; recorded < 200; recorded++) {
+            audit.record("before " + to_string(recorded), "/", recorded, 0, 0);
+        }
+        CHECK(audit.droppedCount() > 0);
+
+        // Keep recording until the flush thread's retry lands a segment
+        fixLog(dir);
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+        uint64_t droppedBefore;
+        do {
+            droppedBefore = audit.droppedCount();
+            audit.record("after " + to_string(recorded), "/", recorded, 0, 0);
+            recorded++;
+            if (audit.droppedCount() != droppedBefore) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        } while (audit.droppedCount() != droppedBefore && chrono::steady_clock::now() < deadline);
+        CHECK(audit.droppedCount() == droppedBefore);
+    }
+
+    vector<AuditRecord> records = readAll(dir);
+    uint64_t commands = 0, dropped = 0, gaps = 0;
+    int64_t next = 0;
+    for (const auto& record : records) {
+        if (record.dropped) {
+            gaps++;
+            dropped += record.dropped;
+            CHECK(record.startNs == next);
+            CHECK(record.gapEndNs == next + int64_t(record.dropped) - 1);
+            next = record.gapEndNs + 1;
+        } else {
+            commands++;
+            CHECK(record.startNs == next);
+            next = record.startNs + 1;
+        }
+    }
+    CHECK(gaps == 1);
+    CHECK(dropped > 0);
+    CHECK(commands + dropped == uint64_t(recorded));
+    CHECK(!records.empty() && records.back().command == "after " + to_string(recorded - 1));
+    filesystem::remove_all(dir);
+}
+
+void testGapAfterMissingDirectory() {
+    filesystem::path moved;
+    checkGapAfterOutage("gap-missing-dir",
+        [&](const filesystem::path& dir) {
+            moved = dir.string() + ".moved";
+            filesystem::rename(dir, moved);
+        },
+        [&](const filesystem::path& dir) {
+            filesystem::rename(moved, dir);
+        });
+}
+
+void testGapAfterNoSpace() {
+    // A file size limit makes preallocation fail the way a full disk does.
+    // Segments must never fall back to sparse files, which would SIGBUS on write.
+    rlimit original;
+    getrlimit(RLIMIT_FSIZE, &original);
+    signal(SIGXFSZ, SIG_IGN);
+    checkGapAfterOutage("gap-no-space",
+        [&](const filesystem::path&) {
+            rlimit limited = original;
+            limited.rlim_cur = 1024;
+            setrlimit(RLIMIT_FSIZE, &limited);
+        },
+        [&](const filesystem::path&) {
+            setrlimit(RLIMIT_FSIZE, &original);
+        });
+    signal(SIGXFSZ, SIG_DFL);
+}
+
+void writeFile(const filesystem::path& path, const string& data) {
+    ofstream file(path, ios::binary);
+    file.write(data.data(), data.size());
+}
+
+string segmentWith(const string& body) {
+    AuditSegmentHeader header = {};
+    memcpy(header.magic, AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+    header.version = AUDIT_VERSION;
+    header.headerSize = sizeof(header);
+    header.capacity = 4096;
+    header.used = sizeof(header) + body.size();
+    return string(reinterpret_cast<char*>(&header), sizeof(header)) + body;
+}
+
+string stringEntry(uint32_t id, const string& text) {
+    AuditStringEntry entry = {{AUDIT_STRING, uint32_t(sizeof(entry) + 8)}, id, uint32_t(text.size())};
+    string padded = text;
+    padded.resize(8, '\0');
+    return string(reinterpret_cast<char*>(&entry), sizeof(entry)) + padded;
+}
+
+void testMalformedSegmentsAreRejected() {
+    filesystem::path dir = scratchDir("malformed");
+    filesystem::create_directories(dir);
+    filesystem::path path = dir / "bad.log";
+
+    for (uint32_t id : {0xFFFFFFFFu, 0x7FFFFFFFu, 1u}) {
+        writeFile(path, segmentWith(stringEntry(id, "abc")));
+        vector<AuditRecord> records;
+        string error;
+        CHECK(!readAuditSegment(path, records, error));
+        CHECK(error.find("corrupt entry") != string::npos);
+    }
+
+    // A command may only reference strings defined before it
+    AuditCommandEntry command = {{AUDIT_COMMAND, sizeof(command)}, 0, 5, 0, 0, 0, 0};
+    writeFile(path, segmentWith(stringEntry(0, "ls") + string(reinterpret_cast<char*>(&command), sizeof(command))));
+    vector<AuditRecord> records;
+    string error;
+    CHECK(!readAuditSegment(path, records, error));
+    CHECK(records.empty());
+
+    writeFile(path, "not an audit segment, but long enough to hold a segment header......");
+    CHECK(!readAuditSegment(path, records, error));
+    filesystem::remove_all(dir);
+}
+
+int main() {
+    testRoundTripWithRotation();
+    testOversizedTextIsClipped();
+    testGapAfterMissingDirectory();
+    testGapAfterNoSpace();
+    testMalformedSegmentsAreRejected();
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all audit tests passed\n");
+    return 0;
+}
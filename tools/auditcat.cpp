@@ -0,0 +1,89 @@
+// auditcat: decode shell audit log segments to text.
+//
+//   auditcat SEGMENT...
+//
+// Prints one tab-separated line per command:
+//   start time (UTC)  exit status  duration  cwd  command
+// Records dropped while no segment was available show up as a line starting
+// with "# gap". Tabs, newlines and backslashes in cwd and command are escaped as \t, \n, \\.
+
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "audit.hpp"
+using namespace std;
+
+string formatTime(int64_t ns) {
+    time_t seconds = ns / 1000000000;
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    char buffer[64];
+    size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", int(ns / 1000000 % 1000));
+    return buffer;
+}
+
+string formatDuration(int64_t ns) {
+    char buffer[32];
+    if (ns < 1000000) {
+        snprintf(buffer, sizeof(buffer), "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buffer, sizeof(buffer), "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.2fs", ns / 1e9);
+    }
+    return buffer;
+}
+
+string escapeField(const string& text) {
+    string escaped;
+    escaped.reserve(text.size());
+    for (char ch : text) {
+        if (ch == '\t') escaped += "\\t";
+        else if (ch == '\n') escaped += "\\n";
+        else if (ch == '\\') escaped += "\\\\";
+        else escaped += ch;
+    }
+    return escaped;
+}
+
+bool decodeSegment(const string& path) {
+    vector<AuditRecord> records;
+    string error;
+    bool ok = readAuditSegment(path, records, error);
+
+    // Print whatever decoded before any error
+    for (const auto& record : records) {
+        if (record.dropped) {
+            cout << "# gap: " << record.dropped << " commands not recorded between "
+                 << formatTime(record.startNs) << " and " << formatTime(record.gapEndNs) << '\n';
+            continue;
+        }
+        cout << formatTime(record.startNs) << '\t'
+             << record.exitStatus << '\t'
+             << formatDuration(record.durationNs) << '\t'
+             << escapeField(record.cwd) << '\t'
+             << escapeField(record.command) << '\n';
+    }
+    if (!ok) {
+        cerr << path << ": " << error << endl;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "usage: auditcat SEGMENT..." << endl;
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!decodeSegment(argv[i])) {
+            result = 1;
+        }
+    }
+    return result;
+}